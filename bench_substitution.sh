@@ -0,0 +1,79 @@
+#!/bin/sh
+# Compares $(...) command substitution against the old way of getting one command's output
+# into another's arguments: redirect it to a file with ">" and feed the file back with xargs.
+# Each case checks that both ways produce the same output before reporting the times.
+# Usage: ./bench_substitution.sh [iterations]
+
+ITERATIONS=${1:-500}
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+W=$WORKDIR
+
+# Usage: add_case name lines substitution-line file-lines...
+# writes the substitution line and the file round-trip lines to the case's batch files
+add_case() {
+    name=$1
+    lines=$2
+    substitution=$3
+    shift 3
+    i=0
+    while [ $i -lt $lines ]; do
+        echo "$substitution" >> "$W/$name.substitution.txt"
+        for line in "$@"; do
+            echo "$line" >> "$W/$name.file.txt"
+        done
+        i=$((i + 1))
+    done
+}
+
+# runs a batch file, keeping only the commands' output (mysh echoes each command, which all start with "/")
+run() {
+    start=$(date +%s%N)
+    ./mysh "$1" > "$1.out"
+    end=$(date +%s%N)
+    grep -v '^/' "$1.out" > "$1.result"
+    echo $(( (end - start) / 1000000 ))
+}
+
+compare() {
+    name=$1
+    lines=$2
+    fileTime=$(run "$W/$name.file.txt")
+    substitutionTime=$(run "$W/$name.substitution.txt")
+    if ! cmp -s "$W/$name.file.txt.result" "$W/$name.substitution.txt.result"; then
+        echo "$name: outputs differ"
+        exit 1
+    fi
+    echo "$name ($lines lines): file round-trip $fileTime ms, substitution $substitutionTime ms"
+}
+
+add_case single $ITERATIONS \
+    "/bin/echo result \$(/bin/echo hello world)" \
+    "/bin/echo hello world > $W/out1" \
+    "/usr/bin/xargs -a $W/out1 /bin/echo result"
+
+# several independent substitutions per line, two of them nested
+add_case nested $ITERATIONS \
+    "/bin/echo \$(/bin/echo a \$(/bin/echo b)) \$(/bin/echo c) \$(/bin/echo d \$(/bin/echo e))" \
+    "/bin/echo b > $W/out1" \
+    "/usr/bin/xargs -a $W/out1 /bin/echo a > $W/out2" \
+    "/bin/echo c > $W/out3" \
+    "/bin/echo e > $W/out4" \
+    "/usr/bin/xargs -a $W/out4 /bin/echo d > $W/out5" \
+    "/bin/cat $W/out2 $W/out3 $W/out5 > $W/out6" \
+    "/usr/bin/xargs -a $W/out6 /bin/echo"
+
+# the same shape with slow commands, where running the substitutions concurrently matters most
+add_case concurrent $((ITERATIONS / 10)) \
+    "/bin/echo \$(/bin/echo \$(/bin/sleep 0.05) a) \$(/bin/echo \$(/bin/sleep 0.05) b) \$(/bin/sleep 0.05)" \
+    "/bin/sleep 0.05 > $W/out1" \
+    "/usr/bin/xargs -a $W/out1 /bin/echo a > $W/out2" \
+    "/bin/sleep 0.05 > $W/out3" \
+    "/usr/bin/xargs -a $W/out3 /bin/echo b > $W/out4" \
+    "/bin/sleep 0.05 > $W/out5" \
+    "/bin/cat $W/out2 $W/out4 $W/out5 > $W/out6" \
+    "/usr/bin/xargs -a $W/out6 /bin/echo"
+
+compare single $ITERATIONS
+compare nested $ITERATIONS
+compare concurrent $((ITERATIONS / 10))
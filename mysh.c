@@ -1,11 +1,15 @@
 // Shell for p1b
 
+#define _GNU_SOURCE     // for memfd_create
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 
 #define MAX 512
@@ -18,18 +22,54 @@ typedef struct aliasNode {
     struct aliasNode* next;
 } aliasNode;
 
+typedef struct substitution {
+    char* text;                         // the command between the parentheses (the whole line for the root)
+    int start;                          // index of the "$" in the parent's text
+    int end;                            // index of the matching ")" in the parent's text
+    struct substitution* parent;
+    struct substitution* firstChild;    // substitutions nested directly inside this one, in order
+    struct substitution* nextSibling;
+    int pendingChildren;                // nested substitutions that haven't finished yet
+    int outputFd;                       // memfd the child writes its stdout into
+    pid_t childPid;
+    char* output;                       // the mapped memfd, split in place into words once the child has finished
+    size_t mappedSize;
+    char** outputWords;                 // the words of the output, pointing into the mapping
+    int numOutputWords;
+} substitution;
+
+typedef struct commandLine {
+    char** argumentVector;              // NULL-terminated
+    char* substituted;                  // 1 if the argument came (even partly) from the output of a $(...)
+    char* owned;                        // 1 if the argument was glued together from several pieces on the heap
+    int numArgs;
+    int capacity;
+    substitution* substitutions;        // the line's substitutions, which own the mapped outputs
+} commandLine;
+
 /* PROTOTYPES */
 void executeCommand(char* parsedCommand[], char* fileName);
-int numberArguments(char* command);
-char** processCommand(char* command);
-int checkForRedirection(char* parsedCommand[], int numArgs);
+int checkForRedirection(char* parsedCommand[], char substituted[], int numArgs);
 int checkAliasCommandFormat(char* parsedCommand[], int numArgs);
 void addAlias(char* aliasName, char** actualCommand, int aliasNumArgs);
 void removeAlias(char* aliasName);
 aliasNode* getAliasNode(char* aliasName);
 void handleAliasing(int aliasType, char* aliasName, char** actualCommand, int aliasNumArgs);
 void printAliasNode(aliasNode* current);
-
+substitution* expandSubstitutions(char* command);
+substitution* newSubstitution(char* text, substitution* parent, int start, int end);
+int findSubstitutions(substitution* node);
+void startSubstitution(substitution* node);
+void startReadySubstitutions(substitution* node);
+void finishSubstitution(substitution* node);
+substitution* getRunningSubstitution(substitution* node, pid_t childPid);
+void freeSubstitutions(substitution* node);
+int parseCommandLine(char* input, commandLine* line);
+void buildCommandLine(substitution* node, commandLine* line);
+void addArgument(commandLine* line, char* piece, int substituted, int glued);
+void freeCommandLine(commandLine* line);
+void runCommandLine(commandLine* line);
+pid_t runSubstitution(commandLine* line, int* outputFd);
 
 void interactive();
 void batch(char* filename);
@@ -58,17 +98,17 @@ aliasNode* getAliasNode(char* aliasName) {
 
 /* Adds an alias to the linked list */
 void addAlias(char* aliasName, char** actualCommand, int aliasNumArgs) {
-	if (aliasListExists == 1) {
-		// if the alias was already there, then remove it so we can replace it
-		if (getAliasNode(aliasName) != NULL) {			
-			write(1, aliasName, strlen(aliasName));
-			for (int i = 0; i < aliasNumArgs; i++) {
-				write(1, " ", 1);
-				write(1, actualCommand[i], strlen(actualCommand[i]));
-			}
-			write(1, "\n", 1);
-			removeAlias(aliasName);
+	// if the alias was already there, then remove it so we can replace it (this may empty the list)
+	if (getAliasNode(aliasName) != NULL) {			
+		write(1, aliasName, strlen(aliasName));
+		for (int i = 0; i < aliasNumArgs; i++) {
+			write(1, " ", 1);
+			write(1, actualCommand[i], strlen(actualCommand[i]));
 		}
+		write(1, "\n", 1);
+		removeAlias(aliasName);
+	}
+	if (aliasListExists == 1) {
 		aliasNode* current = head;
 		// traverse to the end of the linked list
 		while (current->next != NULL) {
@@ -84,6 +124,7 @@ void addAlias(char* aliasName, char** actualCommand, int aliasNumArgs) {
         for (int i = 0; i < aliasNumArgs; i++) {
             newNode->actualCommand[i] = actualCommand[i];
         }
+        newNode->actualCommand[aliasNumArgs] = NULL;
 		//newNode->actualCommand = actualCommand;
 		newNode->aliasNumArgs = aliasNumArgs;
 		newNode->next = NULL;
@@ -99,6 +140,7 @@ void addAlias(char* aliasName, char** actualCommand, int aliasNumArgs) {
         for (int i = 0; i < aliasNumArgs; i++) {
             head->actualCommand[i] = actualCommand[i];
         }
+        head->actualCommand[aliasNumArgs] = NULL;
 		//head->actualCommand = actualCommand;
 		head->aliasNumArgs = aliasNumArgs;
 		head->next = NULL;
@@ -116,12 +158,18 @@ void removeAlias(char* aliasName) {
 		while (current != NULL) {
 			// if we found a match
 			if (strcmp(current->aliasName, aliasName) == 0) {
+				// the node owns its copies of the alias name and the actual command
+				free(current->aliasName);
+				for (int i = 0; i < current->aliasNumArgs; i++) {
+					free(current->actualCommand[i]);
+				}
 				// and the matching node is the first in the list
 				if (current == head) {
 					// and there's only one node in the list
                     if (current->next == NULL) {
                         //returnValue = current->value;
                         free(head); // we used malloc to reserve head, now need to free it
+                        head = NULL;
                         aliasListExists = 0;   // the list doesn't exist anymore, will need to make new
                         return; //returnValue;
                     } else {
@@ -190,103 +238,227 @@ void handleAliasing(int aliasRequestType, char* aliasName, char** actualCommand,
 	}
 }
 
-/* This mode allows users to manually input commands to the shell */
-void interactive() {
-	while (1) {
-		char* prompt = "(Dante Shell) > ";
-		write(1, prompt, strlen(prompt));
-		char buf[MAX];
-        char* input = fgets(buf, MAX, stdin);
-		input[strcspn(input, "\n")] = 0;    // parse the entry to remove trailing newline from fgets
-		int exitRequested = strcmp(input, "exit");
-		if (exitRequested == 0) {
-			exit(1);
-		}		
-		char* command = calloc(1, MAX * sizeof(char));
-		if (command == NULL) {
-			char* failString = "calloc failed to acquire pointer for command.\n";
+/* Given a line of commands as typed, run any $(...) in it and break it into an argument vector.
+   Returns -1 if a substitution was misformatted, 0 otherwise. */
+int parseCommandLine(char* input, commandLine* line) {
+	substitution* root = expandSubstitutions(input);
+	if (root == NULL) {
+		char* substMisformat = "Substitution misformatted.\n";
+		write(1, substMisformat, strlen(substMisformat));
+		return -1;
+	}
+	buildCommandLine(root, line);
+	line->substitutions = root;
+	return 0;
+}
+
+/* Given a substitution node whose nested substitutions have all finished, break its text into an
+   argument vector. Each $(...) contributes the words of its output, which the arguments point
+   straight into; only a word glued to other text (ex. a$(...)b) gets copied. Writes '\0's into
+   the node's text. */
+void buildCommandLine(substitution* node, commandLine* line) {
+	line->capacity = 8;
+	line->argumentVector = (char**) malloc(line->capacity * sizeof(char*));
+	line->substituted = (char*) malloc(line->capacity * sizeof(char));
+	line->owned = (char*) malloc(line->capacity * sizeof(char));
+	if (line->argumentVector == NULL || line->substituted == NULL || line->owned == NULL) {
+		char* failString = "malloc failed to acquire pointer for argument vector.\n";
+		write(1, failString, strlen(failString));
+		exit(1);
+	}
+	line->argumentVector[0] = NULL;
+	line->numArgs = 0;
+	line->substitutions = NULL;
+
+	char* text = node->text;
+	int length = strlen(text);
+	substitution* child = node->firstChild;
+	int glue = 0;   // whether the next piece continues the previous word (no whitespace between them)
+	int i = 0;
+
+	while (i < length) {
+		// a substitution: its output's first word continues the current word, the rest are new words
+		if (child != NULL && i == child->start) {
+			for (int k = 0; k < child->numOutputWords; k++) {
+				addArgument(line, child->outputWords[k], 1, (k == 0) && glue);
+				glue = 1;
+			}
+			i = child->end + 1;
+			child = child->nextSibling;
+			continue;
+		}
+		// whitespace ends the current word
+		if (text[i] == ' ' || text[i] == '\t' || text[i] == '\n' || text[i] == '\0') {
+			glue = 0;
+			i++;
+			continue;
+		}
+		// plain text runs until whitespace or the next substitution, and is terminated in place
+		int j = i;
+		while (j < length && text[j] != ' ' && text[j] != '\t' && text[j] != '\n' && !(child != NULL && j == child->start)) {
+			j++;
+		}
+		text[j] = '\0';
+		addArgument(line, text + i, 0, glue);
+		glue = 1;
+		i = j;
+	}
+}
+
+/* Adds a piece of text to the argument vector, either as a new argument or glued onto the last one */
+void addArgument(commandLine* line, char* piece, int substituted, int glued) {
+	if (glued && line->numArgs > 0) {
+		int last = line->numArgs - 1;
+		char* previous = line->argumentVector[last];
+		char* gluedWord = (char*) malloc((strlen(previous) + strlen(piece) + 1) * sizeof(char));
+		if (gluedWord == NULL) {
+			char* failString = "malloc failed to acquire pointer for argument.\n";
 			write(1, failString, strlen(failString));
 			exit(1);
 		}
-		strcpy(command, input);
-		
-		int numArgs = numberArguments(command);
-		char* argumentVector[numArgs + 1];
-		char** splitCommand;
-		splitCommand = processCommand(command);
-		for (int i = 0; i <= numArgs; i++) {
-			if (i < numArgs) {
-                //argumentVector[i] = splitCommand[i * sizeof(char*)];
-                argumentVector[i] = splitCommand[i];
-            }
-            else {
-                argumentVector[i] = NULL;
-            }
+		strcpy(gluedWord, previous);
+		strcat(gluedWord, piece);
+		if (line->owned[last]) {
+			free(previous);
 		}
-		
-		// check if requesting alias
-		char* aliasName = (char*) malloc(sizeof(char));
-		if (aliasName == NULL) {
-			char* failString = "malloc failed to acquire pointer for alias name.\n";
+		line->argumentVector[last] = gluedWord;
+		line->owned[last] = 1;
+		line->substituted[last] = line->substituted[last] || substituted;
+		return;
+	}
+
+	// leave room for the new argument and the terminating NULL
+	if (line->numArgs + 2 > line->capacity) {
+		line->capacity *= 2;
+		line->argumentVector = (char**) realloc(line->argumentVector, line->capacity * sizeof(char*));
+		line->substituted = (char*) realloc(line->substituted, line->capacity * sizeof(char));
+		line->owned = (char*) realloc(line->owned, line->capacity * sizeof(char));
+		if (line->argumentVector == NULL || line->substituted == NULL || line->owned == NULL) {
+			char* failString = "realloc failed to grow argument vector.\n";
 			write(1, failString, strlen(failString));
 			exit(1);
 		}
-		
-		char** actualCommand = (char**) malloc(sizeof(char*));
+	}
+	line->argumentVector[line->numArgs] = piece;
+	line->substituted[line->numArgs] = substituted;
+	line->owned[line->numArgs] = 0;
+	line->numArgs++;
+	line->argumentVector[line->numArgs] = NULL;
+}
+
+/* Frees an argument vector along with the substitution outputs its arguments point into */
+void freeCommandLine(commandLine* line) {
+	for (int i = 0; i < line->numArgs; i++) {
+		if (line->owned[i]) {
+			free(line->argumentVector[i]);
+		}
+	}
+	free(line->argumentVector);
+	free(line->substituted);
+	free(line->owned);
+	if (line->substitutions != NULL) {
+		freeSubstitutions(line->substitutions);
+	}
+}
+
+/* Given an argument vector, handle an alias/unalias request, or run the command (through its
+   alias if it has one) with any redirection. Words that came from the output of a $(...) are
+   only ever arguments: they can't request an alias, name one, or redirect. */
+void runCommandLine(commandLine* line) {
+	char** argumentVector = line->argumentVector;
+	int numArgs = line->numArgs;
+
+	// nothing to run, ex. a blank line
+	if (numArgs == 0) {
+		return;
+	}
+
+	// check if requesting alias
+	int aliasRequestType = -1;
+	if (!line->substituted[0]) {
+		aliasRequestType = checkAliasCommandFormat(argumentVector, numArgs);
+	}
+	
+	// if we're actually requesting an alias, parse out the alias name and the actual command
+	if (aliasRequestType != -1) {
+		char** actualCommand = (char**) malloc(numArgs * sizeof(char*));
 		if (actualCommand == NULL) {
 			char* failString = "malloc failed to acquire pointer for alias actual comand.\n";
 			write(1, failString, strlen(failString));
 			exit(1);
 		}
-		aliasName = argumentVector[1];
+		char* aliasName = argumentVector[1];
+		int aliasNumArgs = numArgs - 2;
 		for (int i = 2; i < numArgs; i++) {
 			actualCommand[i - 2] = argumentVector[i];
 		}
-		int aliasNumArgs = numArgs - 2;	
-		int aliasRequestType = checkAliasCommandFormat(argumentVector, numArgs);
-		
-		// if we're actually requesting an alias, parse out the alias name and the actual command
-		if (aliasRequestType != -1) {
-			handleAliasing(aliasRequestType, aliasName, actualCommand, aliasNumArgs);
-            continue;   // continue so we don't try to actually run the alias
-		} else {
-			// not requesting an alias so we don't need the heap pointers to actualCommand anymore
-			free(actualCommand);
-		}
-		
-		// if the user creating/listing out aliases, check if they're trying to execute a command via alias
-		aliasNode* relevantAliasNode = getAliasNode(argumentVector[0]);
-		
-		// now that we have the command separated into an array, we need to check if there's any redirection
-		int redirectionCheck = checkForRedirection(argumentVector, numArgs);
-		if (redirectionCheck == 0) {
-			if (relevantAliasNode == NULL) {
-				executeCommand(argumentVector, NULL);
+		// a new alias outlives this line, so it gets its own copy of the words
+		if (aliasRequestType == 1) {
+			// leave room for the terminating NULL in the alias node
+			if (aliasNumArgs >= 512) {
+				char* tooManyArgs = "Too many arguments to alias.\n";
+				write(STDERR_FILENO, tooManyArgs, strlen(tooManyArgs));
+				free(actualCommand);
+				return;
 			}
-			else {
-				executeCommand(relevantAliasNode->actualCommand, NULL);
+			aliasName = strdup(aliasName);
+			for (int i = 0; i < aliasNumArgs; i++) {
+				actualCommand[i] = strdup(actualCommand[i]);
 			}
 		}
-		if (redirectionCheck == 1) {
-			int newNumArgs;
-			newNumArgs = numArgs - 2; // 2 less arguments; take off the redir and the file
-			char* newArgVector[numArgs - 2];
-			for (int i = 0; i <= newNumArgs; i++) {  
-				if (i < newNumArgs) {
-					newArgVector[i] = argumentVector[i];
-				}
-				else {
-					newArgVector[i] = NULL;
-				}
-			}
-			char* fileName = argumentVector[numArgs - 1];
-			executeCommand(newArgVector, fileName);
+		handleAliasing(aliasRequestType, aliasName, actualCommand, aliasNumArgs);
+		free(actualCommand);
+		return;   // return so we don't try to actually run the alias
+	}
+	
+	// if the user creating/listing out aliases, check if they're trying to execute a command via alias
+	aliasNode* relevantAliasNode = NULL;
+	if (!line->substituted[0]) {
+		relevantAliasNode = getAliasNode(argumentVector[0]);
+	}
+	
+	// now that we have the command separated into an array, we need to check if there's any redirection
+	int redirectionCheck = checkForRedirection(argumentVector, line->substituted, numArgs);
+	if (redirectionCheck == 0) {
+		if (relevantAliasNode == NULL) {
+			executeCommand(argumentVector, NULL);
 		}
-		if (redirectionCheck == 2) {
-			char* redirMisformat = "Redirection misformatted.\n";
-			write(1, redirMisformat, strlen(redirMisformat));
+		else {
+			executeCommand(relevantAliasNode->actualCommand, NULL);
 		}
+	}
+	if (redirectionCheck == 1) {
+		// end the argument vector at the redirector for the command, then put it back
+		char* redirector = argumentVector[numArgs - 2];
+		char* fileName = argumentVector[numArgs - 1];
+		argumentVector[numArgs - 2] = NULL;
+		executeCommand(argumentVector, fileName);
+		argumentVector[numArgs - 2] = redirector;
+	}
+	if (redirectionCheck == 2) {
+		char* redirMisformat = "Redirection misformatted.\n";
+		write(1, redirMisformat, strlen(redirMisformat));
+	}
+}
 
+/* This mode allows users to manually input commands to the shell */
+void interactive() {
+	while (1) {
+		char* prompt = "(Dante Shell) > ";
+		write(1, prompt, strlen(prompt));
+		char buf[MAX];
+        char* input = fgets(buf, MAX, stdin);
+		input[strcspn(input, "\n")] = 0;    // parse the entry to remove trailing newline from fgets
+		int exitRequested = strcmp(input, "exit");
+		if (exitRequested == 0) {
+			exit(1);
+		}		
+		commandLine line;
+		if (parseCommandLine(input, &line) == -1) {
+			continue;
+		}
+		runCommandLine(&line);
+		freeCommandLine(&line);
 	}
 }
 
@@ -322,82 +494,14 @@ void batch(char* filename) {
 			exit(1);
 		}
 		
-		int numArgs = numberArguments(command);
-		char* argumentVector[numArgs + 1];
-		char** splitCommand;
-		splitCommand = processCommand(command);
-		for (int i = 0; i <= numArgs; i++) {
-			if (i < numArgs) {
-                //argumentVector[i] = splitCommand[i * sizeof(char*)];
-                argumentVector[i] = splitCommand[i];
-            }
-            else {
-                argumentVector[i] = NULL;
-            }
-		}
-		
-		// check if requesting alias
-		char* aliasName = (char*) malloc(sizeof(char));
-		if (aliasName == NULL) {
-			char* failString = "malloc failed to acquire pointer for alias name.\n";
-			write(1, failString, strlen(failString));
-			exit(1);
-		}
-		
-		char** actualCommand = (char**) malloc(sizeof(char*));
-		if (actualCommand == NULL) {
-			char* failString = "malloc failed to acquire pointer for alias actual comand.\n";
-			write(1, failString, strlen(failString));
-			exit(1);
-		}
-		aliasName = argumentVector[1];
-		for (int i = 2; i < numArgs; i++) {
-			actualCommand[i - 2] = argumentVector[i];
-		}
-		int aliasNumArgs = numArgs - 2;	
-		int aliasRequestType = checkAliasCommandFormat(argumentVector, numArgs);
-		
-		// if we're actually requesting an alias, parse out the alias name and the actual command
-		if (aliasRequestType != -1) {
-			handleAliasing(aliasRequestType, aliasName, actualCommand, aliasNumArgs);
-            continue;   // continue so we don't try to run the alias
-		} else {
-			// not requesting an alias so we don't need the heap pointers to actualCommand anymore
-			free(actualCommand);
-		}
-		
-		// if the user creating/listing out aliases, check if they're trying to execute a command via alias
-		aliasNode* relevantAliasNode = getAliasNode(argumentVector[0]);
-		
-		// now that we have the command separated into an array, we need to check if there's any redirection
-		int redirectionCheck = checkForRedirection(argumentVector, numArgs);
-		if (redirectionCheck == 0) {
-			if (relevantAliasNode == NULL) {
-				executeCommand(argumentVector, NULL);
-			}
-			else {
-				executeCommand(relevantAliasNode->actualCommand, NULL);
-			}
-		}
-		if (redirectionCheck == 1) {
-			int newNumArgs;
-			newNumArgs = numArgs - 2; // 2 less arguments; take off the redir and the file
-			char* newArgVector[numArgs - 2];
-			for (int i = 0; i <= newNumArgs; i++) {  
-				if (i < newNumArgs) {
-					newArgVector[i] = argumentVector[i];
-				}
-				else {
-					newArgVector[i] = NULL;
-				}
-			}
-			char* fileName = argumentVector[numArgs - 1];
-			executeCommand(newArgVector, fileName);
-		}
-		if (redirectionCheck == 2) {
-			char* redirMisformat = "Redirection misformatted.\n";
-			write(1, redirMisformat, strlen(redirMisformat));
+		commandLine line;
+		int parseResult = parseCommandLine(command, &line);
+		free(command);
+		if (parseResult == -1) {
+			continue;
 		}
+		runCommandLine(&line);
+		freeCommandLine(&line);
 	}
 }
 
@@ -478,13 +582,13 @@ int checkAliasCommandFormat(char* parsedCommand[], int numArgs) {
     1: if there is redirection and it's formatted correctly
     2: if there was some attempt at redirection but it wasn't formatted correctly.
 */
-int checkForRedirection(char* parsedCommand[], int numArgs) {
+int checkForRedirection(char* parsedCommand[], char substituted[], int numArgs) {
     int foundRedirector = 0;    // "boolean" to track if we found the redirector
     int redirectorIndex = 0;    // tracks which argument contained the redirector
 
     // search for the redirector operator
     for (int i = 0; i < numArgs; i++) {
-        if (*parsedCommand[i] == '>') {
+        if (*parsedCommand[i] == '>' && !substituted[i]) {
             foundRedirector = 1;
             redirectorIndex = i;
         }
@@ -506,7 +610,7 @@ int checkForRedirection(char* parsedCommand[], int numArgs) {
     }
     
     // if we have two redirectors in a row, this is a formatting error, to be handled later
-    if (*parsedCommand[redirectorIndex + 1] == '>') {
+    if (*parsedCommand[redirectorIndex + 1] == '>' && !substituted[redirectorIndex + 1]) {
         return 2;
     }
 
@@ -534,9 +638,9 @@ void executeCommand(char* parsedCommand[], char* fileName) {
         if (child_pid == 0) {
             execv(parsedCommand[0], parsedCommand);
             // if we got past that line, execv returned, meaning that the command failed
-            char* errorMessage = strcat(parsedCommand[0], ": Command not found.\n");
-            int messageLength = strlen(errorMessage);
-            write(STDERR_FILENO, errorMessage, messageLength);
+            char* errorMessage = ": Command not found.\n";
+            write(STDERR_FILENO, parsedCommand[0], strlen(parsedCommand[0]));
+            write(STDERR_FILENO, errorMessage, strlen(errorMessage));
             _exit(0);
         }
         // parent process. Waits for child to finish.
@@ -557,9 +661,10 @@ void executeCommand(char* parsedCommand[], char* fileName) {
 
             // if couldn't open the file
             if (file == -1) {
-                char* fileOpenErrMsg = strcat("Cannot write to file ", fileName);
-                int fileOpenErrMsgLen = strlen(fileOpenErrMsg) + 2;
-                write(STDERR_FILENO, strcat(fileOpenErrMsg, ".\n"), fileOpenErrMsgLen);
+                char* fileOpenErrMsg = "Cannot write to file ";
+                write(STDERR_FILENO, fileOpenErrMsg, strlen(fileOpenErrMsg));
+                write(STDERR_FILENO, fileName, strlen(fileName));
+                write(STDERR_FILENO, ".\n", 2);
                 _exit(0);
             }
 
@@ -569,9 +674,9 @@ void executeCommand(char* parsedCommand[], char* fileName) {
             execv(parsedCommand[0], parsedCommand);
 
             // if we got past that line, execv returned, meaning that the command failed
-            char* errorMessage = strcat(parsedCommand[0], ": Command not found.\n");
-            int messageLength = strlen(errorMessage);
-            write(STDERR_FILENO, errorMessage, messageLength);
+            char* errorMessage = ": Command not found.\n";
+            write(STDERR_FILENO, parsedCommand[0], strlen(parsedCommand[0]));
+            write(STDERR_FILENO, errorMessage, strlen(errorMessage));
             _exit(0);
         }
         // parent process. Waits for child to finish.
@@ -583,83 +688,257 @@ void executeCommand(char* parsedCommand[], char* fileName) {
 
 }
 
-/* Given a line of commands, count how many commands were given */
-int numberArguments(char* command) {
-
-    int count = 0;
-    int previouslyAtWhiteSpace = 0;
+/* Given a line of commands, run every $(...) in it with its stdout going to a memfd. A
+   substitution starts as soon as everything nested inside it has finished, so independent
+   substitutions run at the same time even when they are nested at different depths. Returns the
+   line as the root of a tree of finished substitutions, or NULL if a "$(" was never closed. */
+substitution* expandSubstitutions(char* command) {
+
+    // the whole line is the root of the tree of substitutions; it's never run itself
+    substitution* root = newSubstitution(strdup(command), NULL, 0, strlen(command));
+    if (findSubstitutions(root) == -1) {
+        freeSubstitutions(root);
+        return NULL;
+    }
 
-    for (int i = 0; i <= strlen(command); i++) {
-        if (!previouslyAtWhiteSpace && (command[i] == ' ' || command[i] == '\t' || command[i] == '\n' || command[i] == '\0')) {
-            previouslyAtWhiteSpace = 1;
-            count++;
+    // start the innermost substitutions, then start each parent once its last child finishes
+    startReadySubstitutions(root);
+    while (root->pendingChildren > 0) {
+        pid_t child_pid = waitpid(-1, NULL, 0);
+        if (child_pid == -1) {
+            break;
         }
-        else if ((command[i] != ' ') && (command[i] != '\t') && (command[i] != '\n') && (command[i] != '\0')) {
-            previouslyAtWhiteSpace = 0;
+        substitution* finished = getRunningSubstitution(root, child_pid);
+        if (finished != NULL) {
+            finishSubstitution(finished);
         }
     }
-    return count;
+    return root;
 }
 
-/* Given a line of commands, break this into an argument vector */
-char** processCommand(char* command) {
-    
-    int i = 0;
+/* Makes a substitution node for the given text (which the node takes ownership of) */
+substitution* newSubstitution(char* text, substitution* parent, int start, int end) {
+    substitution* node = (substitution*) malloc(sizeof(substitution));
+    if (node == NULL || text == NULL) {
+        char* failString = "malloc failed to acquire pointer for substitution.\n";
+        write(1, failString, strlen(failString));
+        exit(1);
+    }
+    node->text = text;
+    node->start = start;
+    node->end = end;
+    node->parent = parent;
+    node->firstChild = NULL;
+    node->nextSibling = NULL;
+    node->pendingChildren = 0;
+    node->outputFd = -1;
+    node->childPid = -1;
+    node->output = NULL;
+    node->mappedSize = 0;
+    node->outputWords = NULL;
+    node->numOutputWords = 0;
+    return node;
+}
 
-    int previouslyAtWhiteSpace = 0;
+/* Finds each $(...) in the node's text and its matching ")", and adds it (along with anything
+   nested inside it) as a child of the node. Returns -1 if a "$(" was never closed, 0 otherwise. */
+int findSubstitutions(substitution* node) {
 
-    // first count all the arguments
-    int count = numberArguments(command);
-    
-    // we can only take 99 different arguments max
-    if (count > 99) {
-        count = 99;
+    int length = strlen(node->text);
+    substitution* lastChild = NULL;
+
+    for (int i = 0; i < length; i++) {
+        if (node->text[i] != '$' || node->text[i + 1] != '(') {
+            continue;
+        }
+        int depth = 1;
+        int j = i + 2;
+        while (j < length) {
+            if (node->text[j] == '(') {
+                depth++;
+            }
+            else if (node->text[j] == ')') {
+                depth--;
+                if (depth == 0) {
+                    break;
+                }
+            }
+            j++;
+        }
+        if (depth != 0) {
+            return -1;
+        }
+
+        substitution* child = newSubstitution(strndup(node->text + i + 2, j - (i + 2)), node, i, j);
+        if (lastChild == NULL) {
+            node->firstChild = child;
+        } else {
+            lastChild->nextSibling = child;
+        }
+        lastChild = child;
+        node->pendingChildren++;
+
+        if (findSubstitutions(child) == -1) {
+            return -1;
+        }
+        i = j;
     }
+    return 0;
+}
 
-    // reserve enough space for all the arguments plus the terminating null
-    char** splitCommand = (char**) malloc((count + 1) * sizeof(char*)); 
+/* Starts a substitution whose nested substitutions have all finished */
+void startSubstitution(substitution* node) {
+    commandLine line;
+    buildCommandLine(node, &line);
 
-    // now create a char* for each argument. Assuming max length of argument is 512
-    for (i = 0; i < count; i++) {
-        char* argumentPointer = malloc(512 * sizeof(char));
-        splitCommand[i] = argumentPointer;
+    // an empty substitution, ex. $(), has nothing to run and no output
+    if (line.numArgs == 0) {
+        freeCommandLine(&line);
+        finishSubstitution(node);
+        return;
+    }
+    node->childPid = runSubstitution(&line, &node->outputFd);
+    freeCommandLine(&line);
 
-        //*(splitCommand + (i * sizeof(char*))) = argumentPointer;
-        
-        //char** location = splitCommand + (i * sizeof(char*));
-        //*location = argumentPointer;
+    // if it couldn't be started, treat it as finished with no output
+    if (node->childPid == -1) {
+        finishSubstitution(node);
     }
-    // now we move the arguments from the command into the splitCommand argument vector
-    previouslyAtWhiteSpace = 0;
-    int currentWordNumber = 0;
-    int currentWordLetterIndex = 0;
-
-    for (i = 0; (i <= strlen(command) + 1); i++) {
-        // if we've already read in all the words in command (to prevent reading in random things)
-        if (currentWordNumber == count) {
-            break;
+}
+
+/* Starts every substitution under the node that has nothing nested inside it */
+void startReadySubstitutions(substitution* node) {
+    for (substitution* child = node->firstChild; child != NULL; child = child->nextSibling) {
+        if (child->pendingChildren == 0) {
+            startSubstitution(child);
+        } else {
+            startReadySubstitutions(child);
         }
-        //char* location = *(splitCommand + (currentWordNumber * sizeof(char*)));
-        char* location = splitCommand[currentWordNumber];
-
-        // when ending a word, enter a null character to signify new entry in array
-        if (!previouslyAtWhiteSpace && (command[i] == ' ' || command[i] == '\t' || command[i] == '\n' || command[i] == '\0')) {
-            previouslyAtWhiteSpace = 1;
-            *(location + currentWordLetterIndex) = '\0';
-            currentWordNumber++;
-            currentWordLetterIndex = 0;
+    }
+}
+
+/* Maps the output of a finished substitution and splits it in place into words, then starts its
+   parent if this was the last nested substitution the parent was waiting on */
+void finishSubstitution(substitution* node) {
+    node->childPid = -1;
+
+    if (node->outputFd != -1) {
+        struct stat outputStat;
+        if (fstat(node->outputFd, &outputStat) == 0 && outputStat.st_size > 0) {
+            // grow the memfd by one zero byte so the last word is terminated too
+            size_t outputSize = outputStat.st_size;
+            if (ftruncate(node->outputFd, outputSize + 1) == 0) {
+                char* mapped = mmap(NULL, outputSize + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, node->outputFd, 0);
+                if (mapped != MAP_FAILED) {
+                    node->output = mapped;
+                    node->mappedSize = outputSize + 1;
+                }
+            }
         }
-        // when we're at a word, copy the character from the command to the array
-        else if ((command[i] != ' ') && (command[i] != '\t') && (command[i] != '\n') && (command[i] != '\0')) {
-            previouslyAtWhiteSpace = 0;
-            *(location + currentWordLetterIndex) = command[i];
-            currentWordLetterIndex++;
+        close(node->outputFd);
+        node->outputFd = -1;
+    }
+
+    // end each word by overwriting the whitespace after it, and point at the start of each word
+    if (node->output != NULL) {
+        int capacity = 8;
+        node->outputWords = (char**) malloc(capacity * sizeof(char*));
+        if (node->outputWords == NULL) {
+            char* failString = "malloc failed to acquire pointer for output words.\n";
+            write(1, failString, strlen(failString));
+            exit(1);
+        }
+        int previouslyAtWhiteSpace = 1;
+        for (size_t i = 0; i < node->mappedSize; i++) {
+            char c = node->output[i];
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\0') {
+                node->output[i] = '\0';
+                previouslyAtWhiteSpace = 1;
+            }
+            else if (previouslyAtWhiteSpace) {
+                previouslyAtWhiteSpace = 0;
+                if (node->numOutputWords == capacity) {
+                    capacity *= 2;
+                    node->outputWords = (char**) realloc(node->outputWords, capacity * sizeof(char*));
+                    if (node->outputWords == NULL) {
+                        char* failString = "realloc failed to grow output words.\n";
+                        write(1, failString, strlen(failString));
+                        exit(1);
+                    }
+                }
+                node->outputWords[node->numOutputWords] = node->output + i;
+                node->numOutputWords++;
+            }
+        }
+    }
+
+    substitution* parent = node->parent;
+    parent->pendingChildren--;
+    if (parent->pendingChildren == 0 && parent->parent != NULL) {
+        startSubstitution(parent);
+    }
+}
+
+/* Given a child pid, find the running substitution under the node that it belongs to */
+substitution* getRunningSubstitution(substitution* node, pid_t childPid) {
+    for (substitution* child = node->firstChild; child != NULL; child = child->nextSibling) {
+        if (child->childPid == childPid) {
+            return child;
+        }
+        substitution* found = getRunningSubstitution(child, childPid);
+        if (found != NULL) {
+            return found;
         }
     }
-    return splitCommand;
+    return NULL;
 }
 
+/* Frees the node and everything nested inside it, unmapping any outputs */
+void freeSubstitutions(substitution* node) {
+    substitution* child = node->firstChild;
+    while (child != NULL) {
+        substitution* nextChild = child->nextSibling;
+        freeSubstitutions(child);
+        child = nextChild;
+    }
+    if (node->output != NULL) {
+        munmap(node->output, node->mappedSize);
+    }
+    free(node->outputWords);
+    if (node->outputFd != -1) {
+        close(node->outputFd);
+    }
+    free(node->text);
+    free(node);
+}
+
+/* Given the argument vector of a $(...), start it in a child process with its stdout going to a
+   new memfd. The child handles it like a typed command line. Stores the memfd in outputFd (-1 on
+   failure) and returns the child's pid (-1 on failure) */
+pid_t runSubstitution(commandLine* line, int* outputFd) {
 
+    *outputFd = memfd_create("mysh-substitution", MFD_CLOEXEC);
+    if (*outputFd == -1) {
+        char* memfdErrMsg = "Cannot create buffer for command substitution.\n";
+        write(STDERR_FILENO, memfdErrMsg, strlen(memfdErrMsg));
+        return -1;
+    }
+
+    pid_t child_pid;
 
+    child_pid = fork();
 
+    // child process
+    if (child_pid == 0) {
+        dup2(*outputFd, STDOUT_FILENO);
+        // run it like any other command line, so aliases and redirection work inside $(...) too
+        runCommandLine(line);
+        _exit(0);
+    }
 
+    if (child_pid == -1) {
+        char* forkErrMsg = "Cannot start command substitution.\n";
+        write(STDERR_FILENO, forkErrMsg, strlen(forkErrMsg));
+    }
+    return child_pid;
+}
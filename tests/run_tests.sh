@@ -0,0 +1,39 @@
+#!/bin/sh
+# Runs mysh on each batch file in tests/ and compares the output with the matching .expected file,
+# then checks that independent nested substitutions run concurrently.
+# Usage: tests/run_tests.sh (from the repo root, after make); set MYSH to test another build
+
+MYSH=${MYSH:-$(pwd)/mysh}
+TESTDIR=$(pwd)/tests
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+failures=0
+
+# run from a scratch directory so tests can redirect to relative files
+cd "$WORKDIR"
+
+for batchFile in "$TESTDIR"/*.txt; do
+    name=$(basename "$batchFile" .txt)
+    "$MYSH" "$batchFile" > "$name.out" 2>&1
+    if diff -u "$TESTDIR/$name.expected" "$name.out"; then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        failures=$((failures + 1))
+    fi
+done
+
+# three nested substitutions that each sleep 1 second should take about 1 second, not 3
+echo '/bin/echo $(/bin/echo $(/bin/sleep 1) a) $(/bin/echo $(/bin/sleep 1) b) $(/bin/echo $(/bin/sleep 1) c)' > concurrency.txt
+start=$(date +%s%N)
+"$MYSH" concurrency.txt > concurrency.out 2>&1
+end=$(date +%s%N)
+elapsed=$(( (end - start) / 1000000 ))
+if [ "$(tail -n 1 concurrency.out)" = "a b c" ] && [ $elapsed -lt 2000 ]; then
+    echo "PASS concurrency ($elapsed ms)"
+else
+    echo "FAIL concurrency ($elapsed ms)"
+    failures=$((failures + 1))
+fi
+
+exit $failures